@@ -14,6 +14,13 @@ pub fn build(b: *std.Build) void {
             "src/database.cpp",
             "src/video_generator.cpp",
             "src/commands.cpp",
+            "src/leaderboard.cpp",
+            "src/snapshot.cpp",
+            "src/balance.cpp",
+            "src/balance_protocol.cpp",
+            "src/balance_server.cpp",
+            "src/balance_client.cpp",
+            "src/mock_gateway.cpp",
         },
         .libraries = &.{
             "dpp",
@@ -3,4 +3,6 @@ PRAGMA foreign_keys = ON;
 CREATE TABLE users (
   id TEXT PRIMARY KEY,
   money INTEGER NOT NULL DEFAULT 0
-)
+);
+
+-- Indexes are created by database::init on startup
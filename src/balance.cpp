@@ -0,0 +1,34 @@
+#include "balance.hpp"
+#include "database.hpp"
+
+namespace balance {
+local_store::local_store(sqlpp::sqlite3::connection &db) : db(db) {
+  index.rebuild(database::queries::get_balances(db));
+}
+
+int local_store::add(const std::string &user_id, int delta) {
+  std::lock_guard lock(mutex);
+
+  const std::optional<int> money = database::queries::get_money(db, user_id);
+
+  if (!money.has_value())
+    database::queries::create_user(db, user_id);
+
+  const int new_money = money.value_or(0) + delta;
+
+  database::queries::set_money(db, user_id, new_money);
+  index.update(user_id, new_money);
+
+  return new_money;
+}
+
+std::vector<leaderboard::entry> local_store::top(size_t k) {
+  return index.top(k);
+}
+
+std::optional<size_t> local_store::rank(const std::string &user_id) {
+  return index.rank(user_id);
+}
+
+size_t local_store::size() { return index.size(); }
+} // namespace balance
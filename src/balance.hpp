@@ -0,0 +1,41 @@
+#pragma once
+
+#include "leaderboard.hpp"
+#include "sqlpp23/sqlite3/database/connection.h"
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace balance {
+// Everything the commands need from the balances, so they can run either next
+// to the database or in a bot process talking to the balance service.
+class store {
+public:
+  virtual ~store() = default;
+
+  // Adds delta to the balance, creating the user if needed, and returns the
+  // new balance.
+  virtual int add(const std::string &user_id, int delta) = 0;
+  virtual std::vector<leaderboard::entry> top(size_t k) = 0;
+  virtual std::optional<size_t> rank(const std::string &user_id) = 0;
+  virtual size_t size() = 0;
+};
+
+// Owns the leaderboard index and keeps it in step with the database.
+class local_store : public store {
+public:
+  explicit local_store(sqlpp::sqlite3::connection &db);
+
+  int add(const std::string &user_id, int delta) override;
+  std::vector<leaderboard::entry> top(size_t k) override;
+  std::optional<size_t> rank(const std::string &user_id) override;
+  size_t size() override;
+
+private:
+  sqlpp::sqlite3::connection &db;
+  leaderboard::index index;
+  std::mutex mutex;
+};
+} // namespace balance
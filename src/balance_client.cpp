@@ -0,0 +1,347 @@
+#include "balance_client.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace balance {
+namespace {
+constexpr std::chrono::milliseconds min_backoff{100};
+constexpr std::chrono::milliseconds max_backoff{5000};
+constexpr std::chrono::milliseconds request_timeout{5000};
+// The service paces its backups, so a large database takes a while
+constexpr std::chrono::milliseconds snapshot_timeout{std::chrono::minutes(10)};
+
+int connect_to(const std::string &socket_path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("Socket path too long: " + socket_path);
+  std::strcpy(addr.sun_path, socket_path.c_str());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1)
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to create socket");
+
+  // A service that stops reading would otherwise block send() forever
+  timeval send_timeout{};
+  send_timeout.tv_sec = request_timeout.count() / 1000;
+  send_timeout.tv_usec = request_timeout.count() % 1000 * 1000;
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+             sizeof(send_timeout));
+
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+    const int err = errno;
+    close(fd);
+    throw std::system_error(err, std::generic_category(),
+                            "Failed to connect to " + socket_path);
+  }
+
+  return fd;
+}
+} // namespace
+
+remote_store::remote_store(const std::string &socket_path)
+    : socket_path(socket_path) {
+  std::lock_guard lock(connection_mutex);
+  reconnect();
+}
+
+remote_store::~remote_store() {
+  {
+    std::lock_guard lock(snapshot_mutex);
+    stopping = true;
+  }
+  snapshot_cv.notify_one();
+  {
+    // Fails a snapshot call in flight instead of waiting for it
+    std::lock_guard lock(connection_mutex);
+    if (fd != -1)
+      shutdown(fd, SHUT_RDWR);
+  }
+  if (snapshot_worker.joinable())
+    snapshot_worker.join();
+
+  std::lock_guard lock(connection_mutex);
+  if (fd != -1)
+    shutdown(fd, SHUT_RDWR);
+  if (reader.joinable())
+    reader.join();
+  if (fd != -1)
+    close(fd);
+}
+
+// Must be called with connection_mutex held
+void remote_store::reconnect() {
+  // The reader of the previous connection has already failed its requests
+  if (reader.joinable())
+    reader.join();
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+
+  {
+    // Keeps a snapshot call from reconnecting behind the destructor
+    std::lock_guard lock(snapshot_mutex);
+    if (stopping)
+      throw std::runtime_error("Balance service connection closed");
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (now < next_attempt)
+    throw std::runtime_error("Balance service unavailable, retrying later");
+
+  try {
+    fd = connect_to(socket_path);
+  } catch (const std::exception &) {
+    backoff = std::clamp(backoff * 2, min_backoff, max_backoff);
+    next_attempt = now + backoff;
+    throw;
+  }
+  backoff = std::chrono::milliseconds(0);
+
+  {
+    std::lock_guard lock(pending_mutex);
+    connected = true;
+  }
+  reader = std::thread(&remote_store::read_responses, this, fd);
+}
+
+std::string remote_store::call(protocol::op op,
+                               const protocol::writer &payload,
+                               std::chrono::milliseconds timeout) {
+  std::future<std::string> response;
+  uint32_t id;
+  int sent_fd;
+  {
+    std::lock_guard lock(connection_mutex);
+
+    bool up;
+    {
+      std::lock_guard pending_lock(pending_mutex);
+      up = connected;
+    }
+    if (!up)
+      reconnect();
+
+    {
+      std::lock_guard pending_lock(pending_mutex);
+      if (!connected)
+        throw std::runtime_error("Balance service connection closed");
+      id = next_id++;
+      response = pending[id].get_future();
+    }
+
+    const std::string frame = protocol::writer()
+                                  .u32(id)
+                                  .u8(static_cast<uint8_t>(op))
+                                  .raw(payload.body())
+                                  .frame();
+    for (size_t sent = 0; sent < frame.size();) {
+      const ssize_t n =
+          send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+      if (n == -1) {
+        if (errno == EINTR)
+          continue;
+        const int err = errno;
+        // Let the reader fail whatever else was in flight on this socket
+        shutdown(fd, SHUT_RDWR);
+        std::lock_guard pending_lock(pending_mutex);
+        pending.erase(id);
+        throw std::system_error(err, std::generic_category(),
+                                "Failed to send to balance service");
+      }
+      sent += n;
+    }
+    sent_fd = fd;
+  }
+
+  if (response.wait_for(timeout) == std::future_status::timeout) {
+    bool answered;
+    {
+      std::lock_guard pending_lock(pending_mutex);
+      answered = pending.erase(id) == 0;
+    }
+
+    // The reader may have answered between the wait and the erase
+    if (!answered) {
+      {
+        // A service this slow is treated as gone, the next call reconnects
+        std::lock_guard lock(connection_mutex);
+        if (fd == sent_fd)
+          shutdown(fd, SHUT_RDWR);
+      }
+      throw std::runtime_error("Balance service did not answer in time");
+    }
+  }
+
+  return response.get();
+}
+
+void remote_store::read_responses(int fd) {
+  std::string buffer;
+  char chunk[65536];
+  for (;;) {
+    const ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    buffer.append(chunk, n);
+
+    size_t offset = 0;
+    try {
+      while (const auto body = protocol::next_frame(buffer, offset)) {
+        protocol::reader in(*body);
+        const uint32_t id = in.u32();
+        const auto status = static_cast<protocol::status>(in.u8());
+
+        std::lock_guard lock(pending_mutex);
+        auto it = pending.find(id);
+        if (it == pending.end())
+          continue;
+        if (status == protocol::status::ok) {
+          it->second.set_value(std::string(in.rest()));
+        } else {
+          it->second.set_exception(
+              std::make_exception_ptr(std::runtime_error(in.str())));
+        }
+        pending.erase(it);
+      }
+    } catch (const std::exception &) {
+      break;
+    }
+    buffer.erase(0, offset);
+  }
+
+  std::lock_guard lock(pending_mutex);
+  connected = false;
+  for (auto &[id, response] : pending) {
+    response.set_exception(std::make_exception_ptr(
+        std::runtime_error("Balance service connection closed")));
+  }
+  pending.clear();
+}
+
+int remote_store::add(const std::string &user_id, int delta) {
+  const std::string response =
+      call(protocol::op::add,
+           protocol::writer().u64(std::stoull(user_id)).i32(delta),
+           request_timeout);
+  return protocol::reader(response).i32();
+}
+
+std::vector<leaderboard::entry> remote_store::top(size_t k) {
+  const std::string response =
+      call(protocol::op::top,
+           protocol::writer().u16(
+               std::min<size_t>(k, std::numeric_limits<uint16_t>::max())),
+           request_timeout);
+  protocol::reader in(response);
+
+  std::vector<leaderboard::entry> entries(in.u16());
+  for (leaderboard::entry &entry : entries) {
+    entry.user_id = std::to_string(in.u64());
+    entry.money = in.i32();
+  }
+
+  return entries;
+}
+
+std::optional<size_t> remote_store::rank(const std::string &user_id) {
+  const std::string response =
+      call(protocol::op::rank, protocol::writer().u64(std::stoull(user_id)),
+           request_timeout);
+  protocol::reader in(response);
+
+  const bool ranked = in.u8();
+  const size_t rank = in.u32();
+  if (!ranked)
+    return std::nullopt;
+
+  return rank;
+}
+
+size_t remote_store::size() {
+  const std::string response = call(protocol::op::size, protocol::writer(), request_timeout);
+  return protocol::reader(response).u32();
+}
+
+void remote_store::request(snapshot::callback on_done) {
+  bool accepted;
+  {
+    std::lock_guard lock(snapshot_mutex);
+    accepted = !stopping;
+    if (accepted) {
+      waiting_snapshots.push_back(std::move(on_done));
+      if (!snapshot_worker.joinable())
+        snapshot_worker = std::thread(&remote_store::run_snapshots, this);
+    }
+  }
+
+  if (!accepted) {
+    on_done({false, {}, {}, 0, "Balance service connection closed"});
+    return;
+  }
+  snapshot_cv.notify_one();
+}
+
+void remote_store::run_snapshots() {
+  std::unique_lock lock(snapshot_mutex);
+  for (;;) {
+    snapshot_cv.wait(lock,
+                     [this] { return stopping || !waiting_snapshots.empty(); });
+    if (stopping)
+      break;
+
+    // One snapshot answers every request made while waiting for it
+    std::vector<snapshot::callback> waiting = std::move(waiting_snapshots);
+    waiting_snapshots.clear();
+    lock.unlock();
+
+    const snapshot::result res = take_snapshot();
+    for (const snapshot::callback &on_done : waiting)
+      on_done(res);
+
+    lock.lock();
+  }
+
+  const snapshot::result closed{false, {}, {}, 0,
+                                "Balance service connection closed"};
+  for (const snapshot::callback &on_done : waiting_snapshots)
+    on_done(closed);
+  waiting_snapshots.clear();
+}
+
+snapshot::result remote_store::take_snapshot() {
+  const auto start = std::chrono::steady_clock::now();
+  snapshot::result res{false, {}, {}, 0, {}};
+  try {
+    const std::string response =
+        call(protocol::op::snapshot, protocol::writer(), snapshot_timeout);
+    protocol::reader in(response);
+
+    res.ok = in.u8();
+    res.duration = std::chrono::milliseconds(in.u32());
+    res.bytes = in.u64();
+    if (res.ok)
+      res.path = in.str();
+    else
+      res.error = in.str();
+  } catch (const std::exception &e) {
+    res.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    res.error = e.what();
+  }
+
+  return res;
+}
+} // namespace balance
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "balance.hpp"
+#include "balance_protocol.hpp"
+#include "snapshot.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace balance {
+// Talks to the balance service over its Unix socket. Requests from every
+// thread share one connection and are pipelined, a reader thread hands each
+// response to the caller waiting on it.
+//
+// When the service goes away the requests in flight fail, and the next call
+// reconnects. Failed attempts back off so handlers fail fast meanwhile. A
+// service that stops answering fails the requests after a timeout and drops
+// the connection.
+//
+// Snapshot requests are forwarded to the scheduler of the service from a
+// background thread, so request() returns at once as with a local scheduler.
+class remote_store : public store, public snapshot::requester {
+public:
+  explicit remote_store(const std::string &socket_path);
+  ~remote_store() override;
+
+  remote_store(const remote_store &) = delete;
+  remote_store &operator=(const remote_store &) = delete;
+
+  int add(const std::string &user_id, int delta) override;
+  std::vector<leaderboard::entry> top(size_t k) override;
+  std::optional<size_t> rank(const std::string &user_id) override;
+  size_t size() override;
+
+  void request(snapshot::callback on_done) override;
+
+private:
+  std::string call(protocol::op op, const protocol::writer &payload,
+                   std::chrono::milliseconds timeout);
+  void reconnect();
+  void read_responses(int fd);
+  void run_snapshots();
+  snapshot::result take_snapshot();
+
+  std::string socket_path;
+
+  // Guards the socket and the reader thread, and serialises writes
+  std::mutex connection_mutex;
+  int fd = -1;
+  std::thread reader;
+  std::chrono::steady_clock::time_point next_attempt;
+  std::chrono::milliseconds backoff{0};
+
+  std::mutex pending_mutex;
+  uint32_t next_id = 0;
+  std::unordered_map<uint32_t, std::promise<std::string>> pending;
+  bool connected = false;
+
+  // Started on the first snapshot request
+  std::mutex snapshot_mutex;
+  std::condition_variable snapshot_cv;
+  std::vector<snapshot::callback> waiting_snapshots;
+  bool stopping = false;
+  std::thread snapshot_worker;
+};
+} // namespace balance
@@ -0,0 +1,102 @@
+#include "balance_protocol.hpp"
+#include <limits>
+#include <stdexcept>
+
+namespace balance::protocol {
+writer &writer::u8(uint8_t value) {
+  data.push_back(static_cast<char>(value));
+  return *this;
+}
+
+writer &writer::u16(uint16_t value) {
+  for (int i = 0; i < 2; i++)
+    u8(value >> (8 * i));
+  return *this;
+}
+
+writer &writer::u32(uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    u8(value >> (8 * i));
+  return *this;
+}
+
+writer &writer::u64(uint64_t value) {
+  for (int i = 0; i < 8; i++)
+    u8(value >> (8 * i));
+  return *this;
+}
+
+writer &writer::i32(int32_t value) { return u32(static_cast<uint32_t>(value)); }
+
+writer &writer::str(std::string_view value) {
+  // The length prefix is a u16, longer strings are truncated
+  value = value.substr(0, std::numeric_limits<uint16_t>::max());
+  u16(value.size());
+  return raw(value);
+}
+
+writer &writer::raw(std::string_view value) {
+  data.append(value);
+  return *this;
+}
+
+std::string writer::frame() const {
+  if (data.size() > max_frame_size)
+    throw std::length_error("Frame too large");
+
+  return writer().u32(data.size()).raw(data).body();
+}
+
+uint64_t reader::little_endian(size_t bytes) {
+  if (data.size() - pos < bytes)
+    throw std::out_of_range("Truncated frame");
+
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++)
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(data[pos + i]))
+             << (8 * i);
+  pos += bytes;
+
+  return value;
+}
+
+uint8_t reader::u8() { return little_endian(1); }
+uint16_t reader::u16() { return little_endian(2); }
+uint32_t reader::u32() { return little_endian(4); }
+uint64_t reader::u64() { return little_endian(8); }
+int32_t reader::i32() { return static_cast<int32_t>(u32()); }
+
+std::string reader::str() {
+  const size_t size = u16();
+  if (data.size() - pos < size)
+    throw std::out_of_range("Truncated frame");
+
+  std::string value(data.substr(pos, size));
+  pos += size;
+
+  return value;
+}
+
+std::string_view reader::rest() {
+  std::string_view value = data.substr(pos);
+  pos = data.size();
+  return value;
+}
+
+std::optional<std::string_view> next_frame(std::string_view buffer,
+                                           size_t &offset) {
+  buffer.remove_prefix(offset);
+  if (buffer.size() < 4)
+    return std::nullopt;
+
+  const uint32_t size = reader(buffer).u32();
+  if (size > max_frame_size)
+    throw std::length_error("Frame too large");
+  if (buffer.size() - 4 < size)
+    return std::nullopt;
+
+  offset += 4 + size;
+
+  return buffer.substr(4, size);
+}
+} // namespace balance::protocol
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Wire format between the bot processes and the balance service. Every frame
+// is a little-endian u32 body length followed by the body. Requests are
+// [u32 id][u8 op][payload] and responses [u32 id][u8 status][payload], so a
+// client may pipeline any number of requests and match responses by id.
+namespace balance::protocol {
+enum class op : uint8_t {
+  // u64 user, i32 delta -> i32 balance
+  add = 1,
+  // u16 k -> u16 count, count * (u64 user, i32 balance)
+  top = 2,
+  // u64 user -> u8 ranked, u32 rank
+  rank = 3,
+  // -> u32 size
+  size = 4,
+  // -> u8 ok, u32 duration ms, u64 bytes, str file name or error. Answered
+  // once the snapshot is written, possibly after later requests.
+  snapshot = 5,
+};
+
+enum class status : uint8_t { ok = 0, error = 1 };
+
+constexpr uint32_t max_frame_size = 1 << 20;
+
+class writer {
+public:
+  writer &u8(uint8_t value);
+  writer &u16(uint16_t value);
+  writer &u32(uint32_t value);
+  writer &u64(uint64_t value);
+  writer &i32(int32_t value);
+  writer &str(std::string_view value);
+  writer &raw(std::string_view value);
+
+  const std::string &body() const { return data; }
+  std::string frame() const;
+
+private:
+  std::string data;
+};
+
+class reader {
+public:
+  explicit reader(std::string_view data) : data(data) {}
+
+  uint8_t u8();
+  uint16_t u16();
+  uint32_t u32();
+  uint64_t u64();
+  int32_t i32();
+  std::string str();
+  std::string_view rest();
+
+private:
+  uint64_t little_endian(size_t bytes);
+
+  std::string_view data;
+  size_t pos = 0;
+};
+
+// Returns the body of the frame starting at offset and moves offset past it,
+// or std::nullopt if buffer does not hold the whole frame yet. Callers erase
+// the consumed prefix once per read rather than once per frame.
+std::optional<std::string_view> next_frame(std::string_view buffer,
+                                           size_t &offset);
+} // namespace balance::protocol
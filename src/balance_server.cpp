@@ -0,0 +1,278 @@
+#include "balance_server.hpp"
+#include "balance_protocol.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace balance {
+namespace {
+std::system_error os_error(const std::string &what) {
+  return std::system_error(errno, std::generic_category(), what);
+}
+
+void set_nonblocking(int fd) {
+  if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+    throw os_error("Failed to make socket non-blocking");
+}
+
+std::string snapshot_response(uint32_t id, const snapshot::result &res) {
+  return protocol::writer()
+      .u32(id)
+      .u8(static_cast<uint8_t>(protocol::status::ok))
+      .u8(res.ok)
+      .u32(res.duration.count())
+      .u64(res.bytes)
+      .str(res.ok ? res.path.filename().string() : res.error)
+      .frame();
+}
+} // namespace
+
+std::string handle(store &backend, std::string_view request) {
+  protocol::reader in(request);
+  protocol::writer out;
+  out.u32(in.u32());
+
+  try {
+    protocol::writer payload;
+    switch (static_cast<protocol::op>(in.u8())) {
+    case protocol::op::add: {
+      const std::string user_id = std::to_string(in.u64());
+      const int32_t delta = in.i32();
+      payload.i32(backend.add(user_id, delta));
+      break;
+    }
+    case protocol::op::top: {
+      const std::vector<leaderboard::entry> entries = backend.top(in.u16());
+      payload.u16(entries.size());
+      for (const leaderboard::entry &entry : entries)
+        payload.u64(std::stoull(entry.user_id)).i32(entry.money);
+      break;
+    }
+    case protocol::op::rank: {
+      const std::optional<size_t> rank = backend.rank(std::to_string(in.u64()));
+      payload.u8(rank.has_value()).u32(rank.value_or(0));
+      break;
+    }
+    case protocol::op::size:
+      payload.u32(backend.size());
+      break;
+    default:
+      throw std::invalid_argument("Unknown op");
+    }
+    out.u8(static_cast<uint8_t>(protocol::status::ok)).raw(payload.body());
+  } catch (const std::exception &e) {
+    out.u8(static_cast<uint8_t>(protocol::status::error)).str(e.what());
+  }
+
+  return out.frame();
+}
+
+server::server(const std::string &socket_path, store &backend)
+    : socket_path(socket_path), backend(backend) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path))
+    throw std::invalid_argument("Socket path too long: " + socket_path);
+  std::strcpy(addr.sun_path, socket_path.c_str());
+
+  if (pipe(wake_fds) == -1)
+    throw os_error("Failed to create wake pipe");
+  set_nonblocking(wake_fds[0]);
+  set_nonblocking(wake_fds[1]);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd == -1)
+    throw os_error("Failed to create socket");
+
+  unlink(socket_path.c_str());
+  if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1)
+    throw os_error("Failed to bind " + socket_path);
+  if (listen(listen_fd, SOMAXCONN) == -1)
+    throw os_error("Failed to listen on " + socket_path);
+  set_nonblocking(listen_fd);
+}
+
+server::~server() {
+  for (const connection &conn : connections)
+    close(conn.fd);
+  close(listen_fd);
+  close(wake_fds[0]);
+  close(wake_fds[1]);
+  unlink(socket_path.c_str());
+}
+
+void server::run() {
+  std::vector<pollfd> fds;
+  while (!stopping) {
+    fds.clear();
+    fds.push_back({wake_fds[0], POLLIN, 0});
+    fds.push_back({listen_fd, POLLIN, 0});
+    for (const connection &conn : connections) {
+      const short events = POLLIN | (conn.out.empty() ? 0 : POLLOUT);
+      fds.push_back({conn.fd, events, 0});
+    }
+
+    if (poll(fds.data(), fds.size(), -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      throw os_error("poll failed");
+    }
+    if (stopping)
+      break;
+    if (fds[0].revents & POLLIN)
+      deliver_snapshots();
+
+    // Only the connections that were polled, new ones are appended below
+    const size_t polled = connections.size();
+    std::vector<bool> alive(polled, true);
+    for (size_t i = 0; i < polled; i++) {
+      const short revents = fds[i + 2].revents;
+      if (revents & (POLLIN | POLLHUP | POLLERR))
+        alive[i] = read_from(connections[i]);
+      if (alive[i] && !connections[i].out.empty())
+        alive[i] = write_to(connections[i]);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < connections.size(); i++) {
+      if (i < polled && !alive[i]) {
+        close(connections[i].fd);
+        continue;
+      }
+      connections[kept++] = std::move(connections[i]);
+    }
+    connections.resize(kept);
+
+    if (fds[1].revents & POLLIN)
+      accept_connections();
+  }
+}
+
+void server::serve_snapshots(snapshot::scheduler *scheduler) {
+  snapshots = scheduler;
+}
+
+void server::stop() {
+  stopping = true;
+  wake();
+}
+
+void server::wake() {
+  const char byte = 0;
+  [[maybe_unused]] ssize_t n = write(wake_fds[1], &byte, 1);
+}
+
+void server::request_snapshot(connection &conn, uint32_t id) {
+  if (!snapshots) {
+    conn.out += protocol::writer()
+                    .u32(id)
+                    .u8(static_cast<uint8_t>(protocol::status::error))
+                    .str("Snapshots are not configured")
+                    .frame();
+    return;
+  }
+
+  // The backup runs on the scheduler thread, the response is queued for the
+  // poll loop, which drops it if the connection is gone by then
+  snapshots->request(
+      [this, serial = conn.serial, id](const snapshot::result &res) {
+        {
+          std::lock_guard lock(finished_mutex);
+          finished.push_back({serial, snapshot_response(id, res)});
+        }
+        wake();
+      });
+}
+
+void server::deliver_snapshots() {
+  char drain[64];
+  while (read(wake_fds[0], drain, sizeof(drain)) > 0) {
+  }
+
+  std::vector<finished_snapshot> ready;
+  {
+    std::lock_guard lock(finished_mutex);
+    ready.swap(finished);
+  }
+
+  for (finished_snapshot &snapshot : ready) {
+    for (connection &conn : connections) {
+      if (conn.serial == snapshot.serial) {
+        conn.out += snapshot.response;
+        break;
+      }
+    }
+  }
+}
+
+void server::accept_connections() {
+  for (;;) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return;
+      throw os_error("accept failed");
+    }
+    set_nonblocking(fd);
+    connections.push_back({next_serial++, fd, {}, {}});
+  }
+}
+
+bool server::read_from(connection &conn) {
+  char buffer[65536];
+  for (;;) {
+    const ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      conn.in.append(buffer, n);
+      continue;
+    }
+    if (n == 0)
+      return false;
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+      break;
+    return false;
+  }
+
+  // Pipelined requests are answered in the order they arrived, except for
+  // snapshots which are answered once they are written
+  try {
+    size_t offset = 0;
+    while (const auto request = protocol::next_frame(conn.in, offset)) {
+      protocol::reader in(*request);
+      const uint32_t id = in.u32();
+      if (static_cast<protocol::op>(in.u8()) == protocol::op::snapshot)
+        request_snapshot(conn, id);
+      else
+        conn.out += handle(backend, *request);
+    }
+    conn.in.erase(0, offset);
+  } catch (const std::exception &) {
+    return false;
+  }
+
+  return true;
+}
+
+bool server::write_to(connection &conn) {
+  while (!conn.out.empty()) {
+    const ssize_t n =
+        send(conn.fd, conn.out.data(), conn.out.size(), MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    conn.out.erase(0, n);
+  }
+
+  return true;
+}
+} // namespace balance
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "balance.hpp"
+#include "snapshot.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace balance {
+// Executes one request body against backend and returns the response frame.
+std::string handle(store &backend, std::string_view request);
+
+// Serves a store to the bot processes over a Unix socket. A single poll loop
+// runs every request, so the database is only ever touched from one thread.
+class server {
+public:
+  server(const std::string &socket_path, store &backend);
+  ~server();
+
+  server(const server &) = delete;
+  server &operator=(const server &) = delete;
+
+  // Answers snapshot requests with scheduler, which must be destroyed before
+  // this server since its callbacks report back here.
+  void serve_snapshots(snapshot::scheduler *scheduler);
+
+  // Blocks until stop() is called
+  void run();
+  // Safe to call from a signal handler
+  void stop();
+
+private:
+  struct connection {
+    uint64_t serial;
+    int fd;
+    std::string in;
+    std::string out;
+  };
+
+  struct finished_snapshot {
+    uint64_t serial;
+    std::string response;
+  };
+
+  void wake();
+  void accept_connections();
+  void request_snapshot(connection &conn, uint32_t id);
+  void deliver_snapshots();
+  bool read_from(connection &conn);
+  bool write_to(connection &conn);
+
+  std::string socket_path;
+  store &backend;
+  int listen_fd = -1;
+  int wake_fds[2] = {-1, -1};
+  std::atomic<bool> stopping = false;
+  std::vector<connection> connections;
+  uint64_t next_serial = 0;
+
+  snapshot::scheduler *snapshots = nullptr;
+  std::mutex finished_mutex;
+  std::vector<finished_snapshot> finished;
+};
+} // namespace balance
@@ -1,6 +1,8 @@
 #include "commands.hpp"
-#include "database.hpp"
 #include "video_generator.hpp"
+#include <future>
+
+#define COMMAND(name, cmd) commands.emplace(name, std::make_unique<cmd>(ctx));
 
 unsigned bounded_rand(unsigned range) {
   for (unsigned x, r;;)
@@ -8,82 +10,173 @@ unsigned bounded_rand(unsigned range) {
       return r;
 }
 
-int give_money(sqlpp::sqlite3::connection &db, const std::string &id,
-               int to_give) {
-  const std::optional<int> money = database::queries::get_money(db, id);
-
-  if (!money.has_value())
-    database::queries::create_user(db, id);
+std::string bold(const std::string &str) { return "**" + str + "**"; }
 
-  const int new_money = money.value_or(0) + to_give;
+const std::string command_failed =
+    "Something went wrong, please try again later";
 
-  database::queries::set_money(db, id, new_money);
+namespace commands {
+invocation invocation::from(const dpp::slashcommand_t &event) {
+  invocation inv{event.command.get_issuing_user().id.str(), {}};
+  for (const dpp::command_data_option &option :
+       event.command.get_command_interaction().options)
+    inv.parameters.emplace(option.name, option.value);
 
-  return new_money;
+  return inv;
 }
 
-int subtract_money(sqlpp::sqlite3::connection &db, const std::string &id,
-                   int to_subtract) {
-  const std::optional<int> money = database::queries::get_money(db, id);
+void command::execute(const dpp::slashcommand_t &event) {
+  response result;
+  try {
+    result = respond(invocation::from(event));
+  } catch (const std::exception &) {
+    event.reply(dpp::message(command_failed).set_flags(dpp::m_ephemeral));
+    return;
+  }
 
-  if (!money.has_value())
-    database::queries::create_user(db, id);
-
-  const int new_money = money.value_or(0) - to_subtract;
+  event.reply(result.content);
+}
 
-  database::queries::set_money(db, id, new_money);
+registry make_registry(command_context *ctx) {
+  registry commands;
+  COMMAND("ping", ping);
+  COMMAND("give_stones", give_stones);
+  COMMAND("roulette", roulette);
+  COMMAND("leaderboard", leaderboard);
+  COMMAND("snapshot", snapshot);
 
-  return new_money;
+  return commands;
 }
 
-std::string bold(const std::string &str) { return "**" + str + "**"; }
-
-namespace commands {
-void ping::execute(const dpp::slashcommand_t &event) { event.reply("Pong!"); }
+response ping::respond(const invocation &) { return {"Pong!"}; }
 
-void give_stones::execute(const dpp::slashcommand_t &event) {
-  const std::string id =
-      std::get<dpp::snowflake>(event.get_parameter("user")).str();
-  const int to_give = std::get<int64_t>(event.get_parameter("stones"));
+response give_stones::respond(const invocation &inv) {
+  const std::string id = inv.get<dpp::snowflake>("user").str();
+  const int to_give = inv.get<int64_t>("stones");
 
-  const int new_money = give_money(ctx->db, id, to_give);
+  const int new_money = ctx->balances.add(id, to_give);
 
-  event.reply("<@" + id + "> now has " + bold(std::to_string(new_money)) +
-              " stones");
+  return {"<@" + id + "> now has " + bold(std::to_string(new_money)) +
+              " stones",
+          id, to_give};
 }
 
 void roulette::execute(const dpp::slashcommand_t &event) {
-  const int spent = std::get<int64_t>(event.get_parameter("money"));
-  const std::string color = std::get<std::string>(event.get_parameter("color"));
-  const std::string user_id = event.command.get_issuing_user().id.str();
-
-  event.thinking(false, [event, this, user_id, spent,
-                         color](const dpp::confirmation_callback_t &callback) {
-    const int rnd = bounded_rand(99) + 1;
-    const Color clr = rnd < 50   ? Color::red
-                      : rnd > 50 ? Color::black
-                                 : Color::green;
-    const bool won = (clr == Color::red && color == "red") ||
-                     (clr == Color::black && color == "black");
-    const int new_money = won ? give_money(ctx->db, user_id, spent)
-                              : subtract_money(ctx->db, user_id, spent);
-    const std::string clr_str = clr == Color::red     ? "🔴 Red"
-                                : clr == Color::black ? "⚫ Black"
-                                                      : "🟢 Green";
-
-    const std::string video_bytes =
-        generate_video("assets/castor.png", "assets/overlay.png");
+  const invocation inv = invocation::from(event);
+
+  event.thinking(false, [event, this,
+                         inv](const dpp::confirmation_callback_t &callback) {
+    response result;
+    try {
+      result = respond(inv);
+    } catch (const std::exception &) {
+      event.edit_original_response(dpp::message(command_failed));
+      return;
+    }
+
+    // The balance has already changed, so the result goes out even without
+    // an animation
+    video spin;
+    try {
+      spin = ctx->videos.render("assets/castor.png", "assets/overlay.png");
+    } catch (const std::exception &) {
+      event.edit_original_response(dpp::message(result.content));
+      return;
+    }
+
     dpp::message msg(event.command.channel_id, "Spinning...");
-    msg.add_file("out.gif", video_bytes, "image/gif");
+    msg.add_file(spin.file_name, spin.bytes, spin.mime_type);
 
     event.edit_original_response(msg);
 
-    sleep(11);
+    sleep(spin.seconds + 3);
+
+    event.edit_original_response(dpp::message(result.content));
+  });
+}
+
+response roulette::respond(const invocation &inv) {
+  const int spent = inv.get<int64_t>("money");
+  const std::string color = inv.get<std::string>("color");
+
+  const int rnd = bounded_rand(99) + 1;
+  const Color clr = rnd < 50   ? Color::red
+                    : rnd > 50 ? Color::black
+                               : Color::green;
+  const bool won = (clr == Color::red && color == "red") ||
+                   (clr == Color::black && color == "black");
+  const int change = won ? spent : -spent;
+  const int new_money = ctx->balances.add(inv.user_id, change);
+  const std::string clr_str = clr == Color::red     ? "🔴 Red"
+                              : clr == Color::black ? "⚫ Black"
+                                                    : "🟢 Green";
+
+  return {"Ball landed on " + clr_str + ".\nYou " + (won ? "won" : "lost") +
+              " " + bold(std::to_string(spent)) + " stones, and now have " +
+              bold(std::to_string(new_money)) + " stones",
+          inv.user_id, change};
+}
+
+void leaderboard::execute(const dpp::slashcommand_t &event) {
+  response result;
+  try {
+    result = respond(invocation::from(event));
+  } catch (const std::exception &) {
+    event.reply(dpp::message(command_failed).set_flags(dpp::m_ephemeral));
+    return;
+  }
+
+  dpp::message msg(event.command.channel_id, result.content);
+  msg.set_allowed_mentions(false, false, false, false, {}, {});
+  event.reply(msg);
+}
+
+response leaderboard::respond(const invocation &inv) {
+  const std::vector<::leaderboard::entry> top = ctx->balances.top(10);
+
+  if (top.empty())
+    return {"Nobody has any stones yet"};
+
+  std::string content;
+  for (size_t i = 0; i < top.size(); i++) {
+    content += std::to_string(i + 1) + ". <@" + top[i].user_id + "> - " +
+               bold(std::to_string(top[i].money)) + " stones\n";
+  }
+
+  const std::optional<size_t> rank = ctx->balances.rank(inv.user_id);
+  if (!rank.has_value()) {
+    content += "\nYou are not ranked yet";
+  } else if (*rank > top.size()) {
+    content += "\nYou are ranked " + bold("#" + std::to_string(*rank)) +
+               " of " + std::to_string(ctx->balances.size());
+  }
 
-    event.edit_original_response(dpp::message(
-        "Ball landed on " + clr_str + ".\nYou " + (won ? "won" : "lost") + " " +
-        bold(std::to_string(spent)) + " stones, and now have " +
-        bold(std::to_string(new_money)) + " stones"));
+  return {content};
+}
+
+void snapshot::execute(const dpp::slashcommand_t &event) {
+  if (!ctx->snapshots) {
+    event.reply(dpp::message("Snapshots are not configured")
+                    .set_flags(dpp::m_ephemeral));
+    return;
+  }
+
+  event.thinking(true, [event, this](const dpp::confirmation_callback_t &) {
+    ctx->snapshots->request([event](const ::snapshot::result &res) {
+      event.edit_original_response(dpp::message(::snapshot::describe(res)));
+    });
   });
 }
+
+response snapshot::respond(const invocation &) {
+  if (!ctx->snapshots)
+    return {"Snapshots are not configured"};
+
+  std::promise<std::string> done;
+  ctx->snapshots->request([&done](const ::snapshot::result &res) {
+    done.set_value(::snapshot::describe(res));
+  });
+
+  return {done.get_future().get()};
+}
 } // namespace commands
@@ -1,13 +1,41 @@
 #pragma once
 
+#include "balance.hpp"
 #include "dpp/dispatcher.h"
-#include "sqlpp23/sqlite3/database/connection.h"
+#include "snapshot.hpp"
+#include "video_generator.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 enum class Color { red, black, green };
 
 namespace commands {
 struct command_context {
-  sqlpp::sqlite3::connection &db;
+  balance::store &balances;
+  video_selector &videos;
+  // nullptr when SNAPSHOT_DIR is not set
+  snapshot::requester *snapshots;
+};
+
+// A slash command without the Discord plumbing, so the mock gateway can drive
+// the same handlers as the real one.
+struct invocation {
+  std::string user_id;
+  std::unordered_map<std::string, dpp::command_value> parameters;
+
+  static invocation from(const dpp::slashcommand_t &event);
+
+  template <typename T> T get(const std::string &name) const {
+    return std::get<T>(parameters.at(name));
+  }
+};
+
+struct response {
+  std::string content;
+  // The balance the command changed, if any
+  std::string changed_user_id;
+  int change = 0;
 };
 
 class command {
@@ -17,21 +45,27 @@ public:
   command(command_context *ctx) : ctx(ctx) {}
 
   virtual ~command() = default;
-  virtual void execute(const dpp::slashcommand_t &event) = 0;
+  // Replies with respond(), or with an error if it throws
+  virtual void execute(const dpp::slashcommand_t &event);
+  virtual response respond(const invocation &inv) = 0;
 };
 
+using registry = std::unordered_map<std::string, std::unique_ptr<command>>;
+
+registry make_registry(command_context *ctx);
+
 class ping : public command {
 public:
   ping(command_context *ctx) : command(ctx) {}
 
-  void execute(const dpp::slashcommand_t &event) override;
+  response respond(const invocation &inv) override;
 };
 
 class give_stones : public command {
 public:
   give_stones(command_context *ctx) : command(ctx) {}
 
-  void execute(const dpp::slashcommand_t &event) override;
+  response respond(const invocation &inv) override;
 };
 
 class roulette : public command {
@@ -39,5 +73,22 @@ public:
   roulette(command_context *ctx) : command(ctx) {}
 
   void execute(const dpp::slashcommand_t &event) override;
+  response respond(const invocation &inv) override;
+};
+
+class leaderboard : public command {
+public:
+  leaderboard(command_context *ctx) : command(ctx) {}
+
+  void execute(const dpp::slashcommand_t &event) override;
+  response respond(const invocation &inv) override;
+};
+
+class snapshot : public command {
+public:
+  snapshot(command_context *ctx) : command(ctx) {}
+
+  void execute(const dpp::slashcommand_t &event) override;
+  response respond(const invocation &inv) override;
 };
 } // namespace commands
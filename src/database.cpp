@@ -2,16 +2,34 @@
 #include "generated/schema.hpp"
 #include "sqlpp23/sqlite3/database/connection.h"
 #include <optional>
+#include <stdexcept>
 
 namespace database {
 sqlpp::sqlite3::connection init(const std::string &database_path) {
   auto config = std::make_shared<sqlpp::sqlite3::connection_config>();
   config->path_to_database = database_path;
-  config->flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+  // The snapshot thread shares this connection with the command handlers
+  config->flags =
+      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX;
 
   sqlpp::sqlite3::connection db;
   db.connect_using(config);
 
+  // The bot does not apply schema.sql itself
+  const castbort::Users users{};
+  try {
+    db(sqlpp::select(users.id).from(users).limit(1u));
+  } catch (const sqlpp::exception &e) {
+    throw std::runtime_error("Table users is missing from " + database_path +
+                             ", apply schema.sql first: " + e.what());
+  }
+
+  // Indexes live here rather than in schema.sql so that databases created
+  // before they were added get them too. users_money covers the leaderboard
+  // rebuild at startup.
+  db.execute("CREATE INDEX IF NOT EXISTS users_money "
+             "ON users (money DESC, id)");
+
   return db;
 }
 
@@ -39,5 +57,19 @@ void create_user(sqlpp::sqlite3::connection &db, const std::string &user_id) {
   const castbort::Users users{};
   db(sqlpp::insert_into(users).set(users.id = user_id));
 }
+
+std::vector<std::pair<std::string, int>>
+get_balances(sqlpp::sqlite3::connection &db) {
+  const castbort::Users users{};
+  std::vector<std::pair<std::string, int>> balances;
+
+  for (const auto &row : db(sqlpp::select(users.id, users.money)
+                                .from(users)
+                                .order_by(users.money.desc()))) {
+    balances.emplace_back(std::string(row.id), row.money);
+  }
+
+  return balances;
+}
 } // namespace queries
 } // namespace database
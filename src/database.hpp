@@ -3,6 +3,8 @@
 #include "sqlpp23/sqlite3/database/connection.h"
 #include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace database {
 sqlpp::sqlite3::connection init(const std::string &database_path);
@@ -13,5 +15,7 @@ std::optional<int> get_money(sqlpp::sqlite3::connection &db,
 void set_money(sqlpp::sqlite3::connection &db, const std::string &user_id,
                int money);
 void create_user(sqlpp::sqlite3::connection &db, const std::string &user_id);
+std::vector<std::pair<std::string, int>>
+get_balances(sqlpp::sqlite3::connection &db);
 } // namespace queries
 } // namespace database
@@ -0,0 +1,58 @@
+#include "leaderboard.hpp"
+#include <algorithm>
+
+namespace leaderboard {
+void index::rebuild(const std::vector<std::pair<std::string, int>> &rows) {
+  std::lock_guard lock(mutex);
+
+  ordered.clear();
+  balances.clear();
+  for (const auto &[user_id, money] : rows) {
+    ordered.insert({money, user_id});
+    balances[user_id] = money;
+  }
+}
+
+void index::update(const std::string &user_id, int money) {
+  std::lock_guard lock(mutex);
+
+  auto it = balances.find(user_id);
+  if (it != balances.end()) {
+    if (it->second == money)
+      return;
+    ordered.erase({it->second, user_id});
+    it->second = money;
+  } else {
+    balances.emplace(user_id, money);
+  }
+  ordered.insert({money, user_id});
+}
+
+std::vector<entry> index::top(std::size_t k) const {
+  std::lock_guard lock(mutex);
+
+  std::vector<entry> result;
+  result.reserve(std::min(k, ordered.size()));
+  for (auto it = ordered.begin(); it != ordered.end() && result.size() < k;
+       ++it) {
+    result.push_back({it->second, it->first});
+  }
+
+  return result;
+}
+
+std::optional<std::size_t> index::rank(const std::string &user_id) const {
+  std::lock_guard lock(mutex);
+
+  auto it = balances.find(user_id);
+  if (it == balances.end())
+    return std::nullopt;
+
+  return ordered.order_of_key({it->second, user_id}) + 1;
+}
+
+std::size_t index::size() const {
+  std::lock_guard lock(mutex);
+  return ordered.size();
+}
+} // namespace leaderboard
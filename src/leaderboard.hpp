@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <ext/pb_ds/assoc_container.hpp>
+#include <ext/pb_ds/tree_policy.hpp>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace leaderboard {
+struct entry {
+  std::string user_id;
+  int money;
+};
+
+// In-memory order-statistic index over every balance, richest first. Ties are
+// broken by user id so that ranks are stable between calls.
+class index {
+public:
+  void rebuild(const std::vector<std::pair<std::string, int>> &balances);
+  void update(const std::string &user_id, int money);
+
+  std::vector<entry> top(std::size_t k) const;
+  // 1-based rank, or std::nullopt if the user has no balance yet.
+  std::optional<std::size_t> rank(const std::string &user_id) const;
+  std::size_t size() const;
+
+private:
+  using key = std::pair<int, std::string>;
+
+  struct richest_first {
+    bool operator()(const key &a, const key &b) const {
+      if (a.first != b.first)
+        return a.first > b.first;
+      return a.second < b.second;
+    }
+  };
+
+  using tree = __gnu_pbds::tree<key, __gnu_pbds::null_type, richest_first,
+                                __gnu_pbds::rb_tree_tag,
+                                __gnu_pbds::tree_order_statistics_node_update>;
+
+  mutable std::mutex mutex;
+  tree ordered;
+  std::unordered_map<std::string, int> balances;
+};
+} // namespace leaderboard
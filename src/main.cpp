@@ -2,23 +2,63 @@
 #include "dpp/cluster.h"
 #include "dpp/once.h"
 
+#include "balance.hpp"
+#include "balance_client.hpp"
+#include "balance_server.hpp"
 #include "commands.hpp"
 #include "database.hpp"
+#include "mock_gateway.hpp"
+#include "snapshot.hpp"
+#include "video_generator.hpp"
+#include <atomic>
+#include <csignal>
+#include <iostream>
 
-#define COMMAND(name, cmd) commands.emplace(name, std::make_unique<cmd>(&ctx));
+const char *env_or(const char *name, const char *fallback) {
+  const char *value = std::getenv(name);
+  return value ? value : fallback;
+}
 
-int main() {
-  dotenv::init();
-  std::srand(std::time({}));
+std::unique_ptr<snapshot::scheduler>
+start_snapshots(sqlpp::sqlite3::connection &db,
+                snapshot::callback on_snapshot) {
+  const char *dir = std::getenv("SNAPSHOT_DIR");
+  if (!dir)
+    return nullptr;
 
-  dpp::cluster bot(std::getenv("BOT_TOKEN"));
-  sqlpp::sqlite3::connection db = database::init(std::getenv("DATABASE_PATH"));
+  snapshot::config config{dir};
+  if (const char *interval = std::getenv("SNAPSHOT_INTERVAL_MINUTES")) {
+    const int minutes = std::stoi(interval);
+    if (minutes < 1)
+      throw std::invalid_argument(
+          "SNAPSHOT_INTERVAL_MINUTES must be at least 1");
+    config.interval = std::chrono::minutes(minutes);
+  }
+  if (const char *keep = std::getenv("SNAPSHOT_KEEP")) {
+    const int count = std::stoi(keep);
+    if (count < 1)
+      throw std::invalid_argument("SNAPSHOT_KEEP must be at least 1");
+    config.keep = count;
+  }
 
-  commands::command_context ctx{db};
-  std::unordered_map<std::string, std::unique_ptr<commands::command>> commands;
-  COMMAND("ping", commands::ping);
-  COMMAND("give_stones", commands::give_stones);
-  COMMAND("roulette", commands::roulette);
+  return std::make_unique<snapshot::scheduler>(db.native_handle(), config,
+                                               std::move(on_snapshot));
+}
+
+void run_bot(dpp::cluster &bot, uint32_t cluster_id, balance::store &balances,
+             snapshot::requester *snapshots) {
+  video_selector::config video_config;
+  if (const char *target = std::getenv("SPIN_TARGET_BYTES"))
+    video_config.target_bytes = std::stoul(target);
+  if (const char *budget = std::getenv("SPIN_ENCODE_BUDGET_MS"))
+    video_config.encode_budget = std::chrono::milliseconds(std::stoi(budget));
+
+  video_selector videos(video_config, [&bot](const render_stats &stats) {
+    bot.log(dpp::ll_info, describe(stats));
+  });
+
+  commands::command_context ctx{balances, videos, snapshots};
+  const commands::registry commands = commands::make_registry(&ctx);
 
   bot.on_log(dpp::utility::cout_logger());
 
@@ -29,8 +69,10 @@ int main() {
     }
   });
 
-  bot.on_ready([&bot](const dpp::ready_t &event) {
-    if (dpp::run_once<struct register_bot_commands>()) {
+  // Global commands only need to be registered by one process
+  bot.on_ready([&bot, cluster_id](const dpp::ready_t &event) {
+    if (cluster_id == 0 &&
+        dpp::run_once<struct register_bot_commands>()) {
       bot.global_command_create(
           dpp::slashcommand("ping", "Ping pong!", bot.me.id));
 
@@ -54,10 +96,106 @@ int main() {
                       .add_choice(dpp::command_option_choice("🔴 Red", "red"))
                       .add_choice(
                           dpp::command_option_choice("⚫ Black", "black"))));
+
+      bot.global_command_create(dpp::slashcommand(
+          "leaderboard", "Show the users with the most stones", bot.me.id));
+
+      bot.global_command_create(
+          dpp::slashcommand("snapshot", "ADMIN: Snapshot the database now",
+                            bot.me.id)
+              .set_default_permissions(dpp::p_manage_guild));
     }
   });
 
   bot.start(dpp::st_wait);
+}
+
+std::atomic<balance::server *> running_server = nullptr;
+
+void stop_running_server(int) {
+  if (balance::server *server = running_server.load())
+    server->stop();
+}
+
+// Owns the database for every bot process of a sharded deployment
+int run_balance_service() {
+  sqlpp::sqlite3::connection db = database::init(std::getenv("DATABASE_PATH"));
+  balance::local_store balances(db);
+
+  balance::server server(std::getenv("BALANCE_SOCKET"), balances);
+
+  // Declared after the server, whose snapshot callbacks must not outlive it
+  const std::unique_ptr<snapshot::scheduler> snapshots =
+      start_snapshots(db, [](const snapshot::result &res) {
+        (res.ok ? std::cout : std::cerr) << snapshot::describe(res) << '\n';
+      });
+  server.serve_snapshots(snapshots.get());
+  running_server = &server;
+  std::signal(SIGINT, stop_running_server);
+  std::signal(SIGTERM, stop_running_server);
+
+  std::cout << "Balance service listening on " << std::getenv("BALANCE_SOCKET")
+            << std::endl;
+  server.run();
+
+  // A second signal during shutdown, e.g. while a snapshot finishes, should
+  // terminate rather than reach a server that is going away
+  std::signal(SIGINT, SIG_DFL);
+  std::signal(SIGTERM, SIG_DFL);
+  running_server = nullptr;
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  dotenv::init();
+  std::srand(std::time({}));
+
+  const std::string mode = argc > 1 ? argv[1] : "";
+
+  if (mode == "balance-service")
+    return run_balance_service();
+
+  if (mode == "mock-gateway") {
+    mock_gateway::config config;
+    config.socket_path = std::getenv("BALANCE_SOCKET");
+    config.shard_count = std::stoul(env_or("SHARD_COUNT", "4"));
+    config.max_clusters = std::stoul(env_or("MAX_CLUSTERS", "2"));
+    config.events = std::stoul(env_or("MOCK_EVENTS", "20000"));
+    config.users = std::stoul(env_or("MOCK_USERS", "1000"));
+    config.guilds = std::stoul(env_or("MOCK_GUILDS", "64"));
+    config.threads = std::stoul(env_or("MOCK_THREADS", "4"));
+    config.seed = std::stoull(env_or("MOCK_SEED", "1"));
+
+    return mock_gateway::run(config);
+  }
+
+  if (mode == "bot") {
+    // dpp runs shard n in the process whose CLUSTER_ID is n % MAX_CLUSTERS
+    const uint32_t shards = std::stoul(env_or("SHARD_COUNT", "0"));
+    const uint32_t cluster_id = std::stoul(env_or("CLUSTER_ID", "0"));
+    const uint32_t max_clusters = std::stoul(env_or("MAX_CLUSTERS", "1"));
+
+    dpp::cluster bot(std::getenv("BOT_TOKEN"), dpp::i_default_intents, shards,
+                     cluster_id, max_clusters);
+    balance::remote_store balances(std::getenv("BALANCE_SOCKET"));
+    // /snapshot is forwarded to the balance service, which owns the database
+    run_bot(bot, cluster_id, balances, &balances);
+
+    return 0;
+  }
+
+  dpp::cluster bot(std::getenv("BOT_TOKEN"));
+  sqlpp::sqlite3::connection db = database::init(std::getenv("DATABASE_PATH"));
+  balance::local_store balances(db);
+
+  const std::unique_ptr<snapshot::scheduler> snapshots =
+      start_snapshots(db, [&bot](const snapshot::result &res) {
+        bot.log(res.ok ? dpp::ll_info : dpp::ll_error,
+                snapshot::describe(res));
+      });
+
+  run_bot(bot, 0, balances, snapshots.get());
 
   return 0;
 }
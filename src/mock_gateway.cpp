@@ -0,0 +1,309 @@
+#include "mock_gateway.hpp"
+#include "balance_client.hpp"
+#include "balance_protocol.hpp"
+#include "commands.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace mock_gateway {
+namespace {
+constexpr uint64_t first_user_id = 100000000000000000ULL;
+
+struct event {
+  uint64_t guild_id;
+  std::string command;
+  commands::invocation inv;
+};
+
+std::string user_id(unsigned user) {
+  return std::to_string(first_user_id + user);
+}
+
+// Every process generates the same stream from the seed
+std::vector<event> generate(const config &cfg) {
+  std::mt19937_64 rng(cfg.seed);
+  std::vector<event> events;
+  events.reserve(cfg.events);
+
+  for (size_t i = 0; i < cfg.events; i++) {
+    // Discord routes a guild to shard (guild_id >> 22) % shard_count
+    const uint64_t guild_id = (rng() % cfg.guilds + 1) << 22;
+    commands::invocation inv{user_id(rng() % cfg.users), {}};
+
+    const unsigned kind = rng() % 10;
+    if (kind == 0) {
+      events.push_back({guild_id, "leaderboard", std::move(inv)});
+    } else if (kind == 1) {
+      inv.parameters["user"] =
+          dpp::snowflake(first_user_id + rng() % cfg.users);
+      inv.parameters["stones"] = static_cast<int64_t>(rng() % 100);
+      events.push_back({guild_id, "give_stones", std::move(inv)});
+    } else {
+      inv.parameters["money"] = static_cast<int64_t>(rng() % 50 + 1);
+      inv.parameters["color"] = std::string(rng() % 2 ? "red" : "black");
+      events.push_back({guild_id, "roulette", std::move(inv)});
+    }
+  }
+
+  return events;
+}
+
+void check(bool ok, const std::string &what) {
+  if (!ok)
+    throw std::runtime_error("Framing check failed: " + what);
+}
+
+// The framing code has no other tests, so check it before every run
+void check_framing() {
+  namespace protocol = balance::protocol;
+
+  const std::string frame =
+      protocol::writer().u32(42).u8(1).str("framing").frame();
+  for (size_t n = 0; n < frame.size(); n++) {
+    size_t offset = 0;
+    check(!protocol::next_frame(std::string_view(frame).substr(0, n), offset),
+          "truncated frame accepted");
+    check(offset == 0, "offset moved on a truncated frame");
+  }
+
+  const std::string pipelined = frame + frame + frame.substr(0, 3);
+  size_t offset = 0;
+  for (int i = 0; i < 2; i++) {
+    const auto body = protocol::next_frame(pipelined, offset);
+    check(body.has_value(), "pipelined frame not found");
+    protocol::reader in(*body);
+    check(in.u32() == 42 && in.u8() == 1 && in.str() == "framing",
+          "pipelined frame decoded wrongly");
+  }
+  check(offset == 2 * frame.size(), "pipelined frames misaligned");
+  check(!protocol::next_frame(pipelined, offset), "partial frame accepted");
+
+  const std::string oversized =
+      protocol::writer().u32(protocol::max_frame_size + 1).body();
+  offset = 0;
+  bool rejected = false;
+  try {
+    protocol::next_frame(oversized, offset);
+  } catch (const std::length_error &) {
+    rejected = true;
+  }
+  check(rejected, "oversized frame accepted");
+
+  const std::string body = protocol::writer().str("truncated").body();
+  rejected = false;
+  try {
+    protocol::reader(std::string_view(body).substr(0, body.size() - 1)).str();
+  } catch (const std::out_of_range &) {
+    rejected = true;
+  }
+  check(rejected, "truncated field accepted");
+}
+
+std::vector<int64_t> read_balances(const config &cfg) {
+  balance::remote_store balances(cfg.socket_path);
+
+  std::vector<int64_t> result(cfg.users);
+  for (unsigned user = 0; user < cfg.users; user++)
+    result[user] = balances.add(user_id(user), 0);
+
+  return result;
+}
+
+void write_all(int fd, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    const ssize_t n = write(fd, bytes, size);
+    if (n <= 0)
+      throw std::runtime_error("Failed to report to the mock gateway");
+    bytes += n;
+    size -= n;
+  }
+}
+
+bool read_all(int fd, void *data, size_t size) {
+  char *bytes = static_cast<char *>(data);
+  while (size > 0) {
+    const ssize_t n = read(fd, bytes, size);
+    if (n <= 0)
+      return false;
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Runs in a child process, as one bot process of the cluster would
+void run_cluster(const config &cfg, const std::vector<event> &events,
+                 uint32_t cluster_id, int report_fd) {
+  balance::remote_store balances(cfg.socket_path);
+  video_selector videos({}, nullptr);
+  commands::command_context ctx{balances, videos, nullptr};
+  const commands::registry registry = commands::make_registry(&ctx);
+
+  std::vector<size_t> owned;
+  for (size_t i = 0; i < events.size(); i++) {
+    const uint32_t shard = (events[i].guild_id >> 22) % cfg.shard_count;
+    // dpp runs shard n in the cluster n % max_clusters
+    if (shard % cfg.max_clusters == cluster_id)
+      owned.push_back(i);
+  }
+
+  std::vector<std::vector<int64_t>> changes(
+      cfg.threads, std::vector<int64_t>(cfg.users));
+  std::vector<std::vector<uint64_t>> handled(cfg.threads);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < cfg.threads; t++) {
+    workers.emplace_back([&, t] {
+      for (size_t i = t; i < owned.size(); i += cfg.threads) {
+        const event &e = events[owned[i]];
+        commands::response res;
+        try {
+          res = registry.at(e.command)->respond(e.inv);
+        } catch (const std::exception &err) {
+          // Not reported as handled, so the parent counts it as lost
+          std::cerr << "Event " << owned[i] << ": " << err.what() << std::endl;
+          continue;
+        }
+
+        handled[t].push_back(owned[i]);
+        if (!res.changed_user_id.empty())
+          changes[t][std::stoull(res.changed_user_id) - first_user_id] +=
+              res.change;
+      }
+    });
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+
+  std::vector<int64_t> total(cfg.users);
+  for (const std::vector<int64_t> &thread_changes : changes)
+    for (unsigned user = 0; user < cfg.users; user++)
+      total[user] += thread_changes[user];
+
+  std::vector<uint64_t> indices;
+  for (const std::vector<uint64_t> &thread_handled : handled)
+    indices.insert(indices.end(), thread_handled.begin(),
+                   thread_handled.end());
+
+  const uint64_t count = indices.size();
+  write_all(report_fd, &count, sizeof(count));
+  write_all(report_fd, indices.data(), indices.size() * sizeof(uint64_t));
+  write_all(report_fd, total.data(), total.size() * sizeof(int64_t));
+}
+} // namespace
+
+int run(const config &cfg) {
+  if (cfg.shard_count == 0 || cfg.max_clusters == 0 || cfg.threads == 0 ||
+      cfg.users == 0 || cfg.guilds == 0)
+    throw std::invalid_argument("Mock gateway sizes must be at least 1");
+
+  check_framing();
+
+  const std::vector<event> events = generate(cfg);
+  // Read before forking, the children must not inherit the reader thread
+  const std::vector<int64_t> before = read_balances(cfg);
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::pair<pid_t, int>> children;
+  for (uint32_t cluster_id = 0; cluster_id < cfg.max_clusters; cluster_id++) {
+    int fds[2];
+    if (pipe(fds) == -1)
+      throw std::runtime_error("Failed to create report pipe");
+
+    const pid_t pid = fork();
+    if (pid == -1)
+      throw std::runtime_error("Failed to fork mock cluster");
+    if (pid == 0) {
+      close(fds[0]);
+      int status = 0;
+      try {
+        run_cluster(cfg, events, cluster_id, fds[1]);
+      } catch (const std::exception &e) {
+        std::cerr << "Cluster " << cluster_id << ": " << e.what() << std::endl;
+        status = 1;
+      }
+      _exit(status);
+    }
+
+    close(fds[1]);
+    children.emplace_back(pid, fds[0]);
+  }
+
+  bool ok = true;
+  // How many processes reported each event as handled
+  std::vector<uint32_t> handled(events.size());
+  size_t unknown = 0;
+  std::vector<int64_t> expected = before;
+  for (const auto &[pid, fd] : children) {
+    uint64_t count;
+    std::vector<uint64_t> indices;
+    std::vector<int64_t> changes(cfg.users);
+    bool reported = read_all(fd, &count, sizeof(count)) &&
+                    count <= events.size();
+    if (reported) {
+      indices.resize(count);
+      reported =
+          read_all(fd, indices.data(), indices.size() * sizeof(uint64_t)) &&
+          read_all(fd, changes.data(), changes.size() * sizeof(int64_t));
+    }
+
+    if (reported) {
+      for (uint64_t i : indices) {
+        if (i < handled.size())
+          handled[i]++;
+        else
+          unknown++;
+      }
+      for (unsigned user = 0; user < cfg.users; user++)
+        expected[user] += changes[user];
+    } else {
+      ok = false;
+    }
+    close(fd);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      ok = false;
+  }
+
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  const size_t lost = std::count(handled.begin(), handled.end(), 0u);
+  const size_t duplicated = std::count_if(
+      handled.begin(), handled.end(), [](uint32_t n) { return n > 1; });
+  if (lost > 0 || duplicated > 0 || unknown > 0) {
+    std::cerr << lost << " events were not handled, " << duplicated
+              << " were handled more than once and " << unknown
+              << " unknown ones were reported" << std::endl;
+    ok = false;
+  }
+
+  const std::vector<int64_t> after = read_balances(cfg);
+  size_t mismatched = 0;
+  for (unsigned user = 0; user < cfg.users; user++) {
+    if (after[user] != expected[user]) {
+      if (mismatched++ < 10)
+        std::cerr << "Balance of " << user_id(user) << " is " << after[user]
+                  << ", expected " << expected[user] << std::endl;
+    }
+  }
+  if (mismatched > 0)
+    ok = false;
+
+  std::cout << events.size() << " events on " << cfg.max_clusters
+            << " processes in " << elapsed.count() << "ms ("
+            << events.size() * 1000 / std::max<long long>(elapsed.count(), 1)
+            << "/s), " << mismatched << " mismatched balances" << std::endl;
+
+  return ok ? 0 : 1;
+}
+} // namespace mock_gateway
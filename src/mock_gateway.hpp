@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Stands in for Discord when testing a sharded deployment on one machine. It
+// replays the same seeded stream of slash commands in one process per
+// cluster, each handling only the events of its own shards through the real
+// command handlers. It then checks that every event was handled by exactly
+// one process, and the balances in the service against what the processes
+// reported.
+namespace mock_gateway {
+struct config {
+  std::string socket_path;
+  uint32_t shard_count = 4;
+  uint32_t max_clusters = 2;
+  size_t events = 20000;
+  unsigned users = 1000;
+  unsigned guilds = 64;
+  // Concurrent handlers per process, their requests are pipelined
+  size_t threads = 4;
+  uint64_t seed = 1;
+};
+
+// Returns 0 when every check passed
+int run(const config &cfg);
+} // namespace mock_gateway
@@ -0,0 +1,223 @@
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+
+namespace snapshot {
+namespace {
+const std::string prefix = "snapshot-";
+const std::string extension = ".db";
+
+std::string timestamp() {
+  const auto now = std::chrono::system_clock::now();
+  const std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+  const auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          now.time_since_epoch())
+                          .count() %
+                      1000;
+
+  std::tm utc;
+  gmtime_r(&seconds, &utc);
+  char buffer[32];
+  const size_t n = std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &utc);
+  std::snprintf(buffer + n, sizeof(buffer) - n, ".%03d",
+                static_cast<int>(millis));
+
+  return buffer;
+}
+
+result shutting_down() {
+  return {false, {}, {}, 0, "Snapshots are shutting down"};
+}
+
+std::string integrity_check(sqlite3 *db) {
+  std::string status;
+  char *err = nullptr;
+  const int rc = sqlite3_exec(
+      db, "PRAGMA integrity_check",
+      [](void *out, int, char **values, char **) {
+        auto *status = static_cast<std::string *>(out);
+        if (status->empty() && values[0])
+          *status = values[0];
+        return 0;
+      },
+      &status, &err);
+
+  if (rc != SQLITE_OK) {
+    status = err ? err : sqlite3_errstr(rc);
+    sqlite3_free(err);
+  }
+
+  return status;
+}
+
+void backup(sqlite3 *source, const std::filesystem::path &path,
+            const config &cfg) {
+  sqlite3 *dest = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &dest,
+                      SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                      nullptr) != SQLITE_OK) {
+    const std::string error = sqlite3_errmsg(dest);
+    sqlite3_close(dest);
+    throw std::runtime_error("Failed to open " + path.string() + ": " + error);
+  }
+
+  sqlite3_backup *bak = sqlite3_backup_init(dest, "main", source, "main");
+  if (!bak) {
+    const std::string error = sqlite3_errmsg(dest);
+    sqlite3_close(dest);
+    throw std::runtime_error("Failed to start backup: " + error);
+  }
+
+  int rc;
+  do {
+    rc = sqlite3_backup_step(bak, cfg.pages_per_step);
+    if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+      std::this_thread::sleep_for(cfg.step_pause);
+  } while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+  sqlite3_backup_finish(bak);
+
+  if (rc != SQLITE_DONE) {
+    sqlite3_close(dest);
+    throw std::runtime_error(std::string("Backup failed: ") +
+                             sqlite3_errstr(rc));
+  }
+
+  const std::string status = integrity_check(dest);
+  sqlite3_close(dest);
+  if (status != "ok") {
+    throw std::runtime_error("Integrity check failed: " + status);
+  }
+}
+} // namespace
+
+std::string describe(const result &res) {
+  if (!res.ok) {
+    return "Snapshot failed after " + std::to_string(res.duration.count()) +
+           "ms: " + res.error;
+  }
+
+  return "Snapshot " + res.path.filename().string() + " written in " +
+         std::to_string(res.duration.count()) + "ms (" +
+         std::to_string(res.bytes) + " bytes)";
+}
+
+scheduler::scheduler(sqlite3 *source, config cfg, callback on_snapshot)
+    : source(source), cfg(std::move(cfg)), on_snapshot(std::move(on_snapshot)) {
+  // A zero interval would make the worker snapshot back to back forever
+  if (this->cfg.interval < std::chrono::minutes(1))
+    throw std::invalid_argument("Snapshot interval must be at least a minute");
+  if (this->cfg.keep < 1)
+    throw std::invalid_argument("At least one snapshot must be kept");
+
+  std::filesystem::create_directories(this->cfg.directory);
+  worker = std::thread(&scheduler::run, this);
+}
+
+scheduler::~scheduler() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  worker.join();
+
+  // Whoever is still waiting for an on-demand snapshot gets an answer
+  for (const callback &on_done : pending)
+    on_done(shutting_down());
+}
+
+void scheduler::request(callback on_done) {
+  bool accepted;
+  {
+    std::lock_guard lock(mutex);
+    accepted = !stopping;
+    if (accepted) {
+      if (on_done)
+        pending.push_back(std::move(on_done));
+      requested = true;
+    }
+  }
+
+  if (accepted)
+    cv.notify_all();
+  else if (on_done)
+    on_done(shutting_down());
+}
+
+void scheduler::run() {
+  std::unique_lock lock(mutex);
+  while (!stopping) {
+    cv.wait_for(lock, cfg.interval, [this] { return stopping || requested; });
+    if (stopping)
+      break;
+
+    std::vector<callback> waiting = std::move(pending);
+    pending.clear();
+    requested = false;
+
+    lock.unlock();
+    const result res = take();
+    if (on_snapshot)
+      on_snapshot(res);
+    for (const callback &on_done : waiting)
+      on_done(res);
+    lock.lock();
+  }
+}
+
+result scheduler::take() {
+  const auto start = std::chrono::steady_clock::now();
+  const std::string name = prefix + timestamp() + extension;
+  const std::filesystem::path path = cfg.directory / name;
+  const std::filesystem::path tmp_path = cfg.directory / (name + ".tmp");
+
+  result res{false, path, {}, 0, {}};
+  try {
+    std::filesystem::remove(tmp_path);
+    backup(source, tmp_path, cfg);
+    std::filesystem::rename(tmp_path, path);
+    res.bytes = std::filesystem::file_size(path);
+  } catch (const std::exception &e) {
+    std::error_code ec;
+    std::filesystem::remove(tmp_path, ec);
+    res.error = e.what();
+  }
+
+  // Only a snapshot that was written and pruned counts as a success, so a
+  // directory that keeps growing does not go unnoticed
+  if (res.error.empty()) {
+    try {
+      rotate();
+      res.ok = true;
+    } catch (const std::exception &e) {
+      res.error = name + " was written but old snapshots could not be "
+                         "removed: " +
+                  e.what();
+    }
+  }
+  res.duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  return res;
+}
+
+void scheduler::rotate() {
+  std::vector<std::filesystem::path> snapshots;
+  for (const auto &entry : std::filesystem::directory_iterator(cfg.directory)) {
+    const std::string name = entry.path().filename().string();
+    if (entry.is_regular_file() && name.starts_with(prefix) &&
+        name.ends_with(extension))
+      snapshots.push_back(entry.path());
+  }
+
+  if (snapshots.size() <= cfg.keep)
+    return;
+
+  // Timestamps sort lexicographically, so the oldest snapshots come first
+  std::sort(snapshots.begin(), snapshots.end());
+  for (size_t i = 0; i < snapshots.size() - cfg.keep; i++)
+    std::filesystem::remove(snapshots[i]);
+}
+} // namespace snapshot
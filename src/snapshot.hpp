@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <sqlite3.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace snapshot {
+struct config {
+  std::filesystem::path directory;
+  std::chrono::minutes interval{60};
+  // Number of snapshot files kept in directory, oldest are removed first.
+  size_t keep = 24;
+  // The source database is only locked while a step copies this many pages.
+  int pages_per_step = 64;
+  std::chrono::milliseconds step_pause{10};
+};
+
+struct result {
+  bool ok;
+  std::filesystem::path path;
+  std::chrono::milliseconds duration;
+  std::uintmax_t bytes;
+  std::string error;
+};
+
+using callback = std::function<void(const result &)>;
+
+std::string describe(const result &res);
+
+// Something that can take a snapshot on demand, either the scheduler itself
+// or the balance service owning it.
+class requester {
+public:
+  virtual ~requester() = default;
+
+  virtual void request(callback on_done) = 0;
+};
+
+// Copies the live database with the SQLite online backup API on a background
+// thread, on a fixed interval and whenever request() is called.
+class scheduler : public requester {
+public:
+  scheduler(sqlite3 *source, config cfg, callback on_snapshot);
+  ~scheduler() override;
+
+  scheduler(const scheduler &) = delete;
+  scheduler &operator=(const scheduler &) = delete;
+
+  void request(callback on_done) override;
+
+private:
+  void run();
+  result take();
+  void rotate();
+
+  sqlite3 *source;
+  config cfg;
+  callback on_snapshot;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<callback> pending;
+  bool requested = false;
+  bool stopping = false;
+  std::thread worker;
+};
+} // namespace snapshot
@@ -1,22 +1,114 @@
+#include "video_generator.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
-std::string generate_video(const std::string &f1_path,
-                           const std::string &f2_path) {
+namespace {
+struct profile_settings {
+  int seconds;
+  int fps;
+  int width;
+  int max_colors;
+  std::string extension;
+  std::string mime_type;
+  // Pessimistic guesses used until the profile has been measured
+  double initial_encode_ms;
+  double initial_bytes;
+};
 
-  std::string cmd =
-      "ffmpeg -y -loglevel error -nostats "
-      "-loop 1 -t 8 -i \"" +
-      f1_path + "\" -i \"" + f2_path +
-      "\" "
-      "-filter_complex "
-      "\"[0:v]rotate='2*PI*min(t,7)*(1-min(t,7)/"
+profile_settings settings_for(video_profile profile) {
+  switch (profile) {
+  case video_profile::gif_full:
+    return {8, 15, 480, 64, "gif", "image/gif", 3000, 3e6};
+  case video_profile::webp:
+    return {8, 15, 480, 0, "webp", "image/webp", 6000, 2e6};
+  case video_profile::gif_reduced:
+    return {8, 10, 320, 32, "gif", "image/gif", 1500, 1e6};
+  case video_profile::still:
+    return {0, 0, 480, 0, "png", "image/png", 300, 2e5};
+  }
+  throw std::invalid_argument("Unknown video profile");
+}
+
+std::string ffmpeg_command(const std::string &f1_path,
+                           const std::string &f2_path,
+                           video_profile profile) {
+  const profile_settings s = settings_for(profile);
+  const std::string inputs = "ffmpeg -y -loglevel error -nostats "
+                             "-loop 1 -t 8 -i \"" +
+                             f1_path + "\" -i \"" + f2_path + "\" ";
+
+  if (profile == video_profile::still) {
+    return inputs + "-filter_complex \"[0:v][1:v]overlay=(W-w)/2:(H-h)/2,"
+                    "scale=" +
+           std::to_string(s.width) +
+           ":-2\" "
+           "-frames:v 1 -c:v png -f image2pipe -";
+  }
+
+  const std::string animation =
+      "[0:v]rotate='2*PI*min(t,7)*(1-min(t,7)/"
       "14)':c=none:ow=rotw(iw):oh=roth(ih)[r];"
-      "[r][1:v]overlay=(W-w)/2:(H-h)/2,fps=15,scale=480:-2,split=2[s0][s1];"
-      "[s0]palettegen=max_colors=64[p];"
-      "[s1][p]paletteuse=dither=none\" "
-      "-f gif -";
+      "[r][1:v]overlay=(W-w)/2:(H-h)/2,fps=" +
+      std::to_string(s.fps) + ",scale=" + std::to_string(s.width) + ":-2";
+
+  if (profile == video_profile::webp) {
+    return inputs + "-filter_complex \"" + animation +
+           "\" "
+           "-c:v libwebp -lossless 0 -q:v 60 -compression_level 2 -loop 0 "
+           "-f webp -";
+  }
+
+  return inputs + "-filter_complex \"" + animation +
+         ",split=2[s0][s1];"
+         "[s0]palettegen=max_colors=" +
+         std::to_string(s.max_colors) +
+         "[p];"
+         "[s1][p]paletteuse=dither=none\" "
+         "-f gif -";
+}
+
+// Renders per core across the machine, which also counts ffmpeg runs of other
+// bot processes
+double machine_load() {
+  double load;
+  const unsigned cores = std::thread::hardware_concurrency();
+  if (cores == 0 || getloadavg(&load, 1) != 1)
+    return 0;
+
+  return load / cores;
+}
+
+// Exponentially weighted moving average, the first sample replaces the
+// initial guess
+void smooth(double &average, double sample, bool measured) {
+  average = measured ? average * 0.8 + sample * 0.2 : sample;
+}
+} // namespace
+
+std::string profile_name(video_profile profile) {
+  switch (profile) {
+  case video_profile::gif_full:
+    return "gif_full";
+  case video_profile::webp:
+    return "webp";
+  case video_profile::gif_reduced:
+    return "gif_reduced";
+  case video_profile::still:
+    return "still";
+  }
+  return "unknown";
+}
+
+video generate_video(const std::string &f1_path, const std::string &f2_path,
+                     video_profile profile) {
+  const profile_settings s = settings_for(profile);
+  const std::string cmd = ffmpeg_command(f1_path, f2_path, profile);
 
   FILE *pipe = popen(cmd.c_str(), "r");
   if (!pipe) {
@@ -44,5 +136,180 @@ std::string generate_video(const std::string &f1_path,
     throw std::runtime_error("ffmpeg terminated abnormally");
   }
 
-  return result;
+  return {profile, std::move(result), "out." + s.extension, s.mime_type,
+          s.seconds};
+}
+
+std::string describe(const render_stats &stats) {
+  char load[16];
+  std::snprintf(load, sizeof(load), "%.1f", stats.load);
+
+  return "Spin rendered as " + profile_name(stats.profile) + " in " +
+         std::to_string(stats.encode_time.count()) + "ms (" +
+         std::to_string(stats.bytes) + " bytes, " +
+         std::to_string(stats.concurrent_renders) + " renders running, load " +
+         load + ", " +
+         std::to_string(stats.spins ? stats.bytes_uploaded / stats.spins : 0) +
+         " bytes per spin over " + std::to_string(stats.spins) + " spins)" +
+         (stats.failed_renders
+              ? " after " + std::to_string(stats.failed_renders) +
+                    " failed renders"
+              : "");
+}
+
+video_selector::video_selector(
+    config cfg, std::function<void(const render_stats &)> on_render)
+    : cfg(cfg), on_render(std::move(on_render)),
+      load_updated(std::chrono::steady_clock::now()) {
+  for (video_profile profile : video_profiles) {
+    const profile_settings s = settings_for(profile);
+    estimates[static_cast<size_t>(profile)] = {
+        s.initial_encode_ms, s.initial_bytes, s.initial_encode_ms,
+        s.initial_bytes, false, load_updated};
+  }
+}
+
+video_selector::estimate
+video_selector::current(video_profile profile,
+                        std::chrono::steady_clock::time_point now) const {
+  estimate e = estimates[static_cast<size_t>(profile)];
+  const double half_lives =
+      std::chrono::duration<double>(now - e.updated) / cfg.estimate_half_life;
+  const double weight = std::pow(0.5, half_lives);
+
+  e.encode_ms =
+      e.initial_encode_ms + (e.encode_ms - e.initial_encode_ms) * weight;
+  e.bytes = e.initial_bytes + (e.bytes - e.initial_bytes) * weight;
+
+  return e;
+}
+
+double video_selector::advance_load(std::chrono::steady_clock::time_point now) {
+  load_integral +=
+      running *
+      std::chrono::duration<double, std::milli>(now - load_updated).count();
+  load_updated = now;
+
+  return load_integral;
+}
+
+video_profile video_selector::pick(double load) const {
+  std::lock_guard lock(mutex);
+  const auto now = std::chrono::steady_clock::now();
+
+  for (video_profile profile : video_profiles) {
+    const estimate e = current(profile, now);
+    const bool fits_size = e.bytes <= cfg.target_bytes;
+    const bool fits_time =
+        e.encode_ms * std::max(load, 1.0) <= cfg.encode_budget.count();
+    if (fits_size && fits_time)
+      return profile;
+  }
+
+  return video_profile::still;
+}
+
+video video_selector::render(const std::string &f1_path,
+                             const std::string &f2_path) {
+  size_t concurrent_renders;
+  {
+    std::lock_guard lock(mutex);
+    advance_load(std::chrono::steady_clock::now());
+    concurrent_renders = ++running;
+  }
+
+  const double load =
+      std::max(static_cast<double>(concurrent_renders), machine_load());
+  size_t failed_renders = 0;
+
+  // A failed profile is skipped for the next spins and this one falls back to
+  // the cheaper profiles, ending with the still
+  for (size_t i = static_cast<size_t>(pick(load)); i < video_profiles.size();
+       i++) {
+    const video_profile profile = video_profiles[i];
+    const auto start = std::chrono::steady_clock::now();
+    double load_at_start;
+    {
+      std::lock_guard lock(mutex);
+      load_at_start = advance_load(start);
+    }
+
+    video result;
+    try {
+      result = generate_video(f1_path, f2_path, profile);
+    } catch (const std::exception &) {
+      mark_failed(profile);
+      failed_renders++;
+      if (profile != video_profile::still)
+        continue;
+
+      std::lock_guard lock(mutex);
+      advance_load(std::chrono::steady_clock::now());
+      --running;
+      throw;
+    }
+
+    const auto end = std::chrono::steady_clock::now();
+    double load_at_end;
+    {
+      std::lock_guard lock(mutex);
+      load_at_end = advance_load(end);
+      --running;
+    }
+
+    // Renders started after this one slow it down too, so average over the
+    // whole render instead of taking the count at its start
+    const double elapsed_ms =
+        std::chrono::duration<double, std::milli>(end - start).count();
+    const double own_load =
+        elapsed_ms > 0 ? (load_at_end - load_at_start) / elapsed_ms : 1.0;
+
+    record(profile,
+           std::chrono::duration_cast<std::chrono::milliseconds>(end - start),
+           result.bytes.size(), concurrent_renders,
+           std::max({own_load, machine_load(), 1.0}), failed_renders);
+
+    return result;
+  }
+
+  throw std::logic_error("The still profile was not tried");
+}
+
+void video_selector::mark_failed(video_profile profile) {
+  std::lock_guard lock(mutex);
+  const auto now = std::chrono::steady_clock::now();
+  estimate &e = estimates[static_cast<size_t>(profile)];
+  e = current(profile, now);
+  // Twice the budget keeps the profile out of picks until it has decayed back
+  // to its initial guess for about a half-life
+  e.encode_ms = std::max(e.encode_ms, 2.0 * cfg.encode_budget.count());
+  e.measured = true;
+  e.updated = now;
+}
+
+void video_selector::record(video_profile profile,
+                            std::chrono::milliseconds encode_time,
+                            size_t bytes, size_t concurrent_renders,
+                            double load, size_t failed_renders) {
+  render_stats stats;
+  {
+    std::lock_guard lock(mutex);
+    const auto now = std::chrono::steady_clock::now();
+    estimate &e = estimates[static_cast<size_t>(profile)];
+    e = current(profile, now);
+    // Renders share the CPU, so normalise to a render on an idle machine
+    smooth(e.encode_ms, static_cast<double>(encode_time.count()) / load,
+           e.measured);
+    smooth(e.bytes, static_cast<double>(bytes), e.measured);
+    e.measured = true;
+    e.updated = now;
+
+    spins++;
+    bytes_uploaded += bytes;
+    stats = {profile, encode_time, bytes, concurrent_renders,
+             load, spins, bytes_uploaded, failed_renders};
+  }
+
+  if (on_render)
+    on_render(stats);
 }
@@ -1,6 +1,103 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
 
-std::string generate_video(const std::string &f1_path,
-                           const std::string &f2_path);
+// Ordered from the richest to the cheapest output
+enum class video_profile { gif_full, webp, gif_reduced, still };
+
+constexpr std::array<video_profile, 4> video_profiles{
+    video_profile::gif_full, video_profile::webp, video_profile::gif_reduced,
+    video_profile::still};
+
+struct video {
+  video_profile profile;
+  std::string bytes;
+  std::string file_name;
+  std::string mime_type;
+  // Length of the animation, 0 for a still
+  int seconds;
+};
+
+std::string profile_name(video_profile profile);
+
+video generate_video(const std::string &f1_path, const std::string &f2_path,
+                     video_profile profile = video_profile::gif_full);
+
+struct render_stats {
+  video_profile profile;
+  std::chrono::milliseconds encode_time;
+  size_t bytes;
+  // Renders of this process running when this one started, including itself
+  size_t concurrent_renders;
+  // Average slowdown over the whole render, from this process's renders or
+  // the load of the machine, whichever is higher
+  double load;
+  uint64_t spins;
+  uint64_t bytes_uploaded;
+  // Richer profiles that failed before this one was rendered
+  size_t failed_renders;
+};
+
+std::string describe(const render_stats &stats);
+
+// Picks a profile for every spin from the current load, the estimated encode
+// time and size of each profile, and a target upload size. Estimates start
+// from conservative defaults and follow the measurements. Estimates that stop
+// being measured decay back to the defaults, so richer profiles are tried
+// again once the load is gone.
+class video_selector {
+public:
+  struct config {
+    size_t target_bytes = 4 * 1024 * 1024;
+    // How long a spin may wait for its render while sharing the CPU
+    std::chrono::milliseconds encode_budget{6000};
+    std::chrono::seconds estimate_half_life{600};
+  };
+
+  video_selector(config cfg,
+                 std::function<void(const render_stats &)> on_render);
+
+  // Falls back to cheaper profiles when a render fails, throws only when the
+  // still fails too
+  video render(const std::string &f1_path, const std::string &f2_path);
+  // load is how many renders share each core, at least 1
+  video_profile pick(double load) const;
+
+private:
+  struct estimate {
+    double initial_encode_ms;
+    double initial_bytes;
+    double encode_ms;
+    double bytes;
+    bool measured;
+    std::chrono::steady_clock::time_point updated;
+  };
+
+  // The estimate with its decay towards the initial guesses applied
+  estimate current(video_profile profile,
+                   std::chrono::steady_clock::time_point now) const;
+  // Adds up renders running times milliseconds, so the average over any
+  // interval can be taken from two readings
+  double advance_load(std::chrono::steady_clock::time_point now);
+  void record(video_profile profile, std::chrono::milliseconds encode_time,
+              size_t bytes, size_t concurrent_renders, double load,
+              size_t failed_renders);
+  // Makes the profile look too slow to pick until its estimate decays
+  void mark_failed(video_profile profile);
+
+  config cfg;
+  std::function<void(const render_stats &)> on_render;
+
+  mutable std::mutex mutex;
+  size_t running = 0;
+  double load_integral = 0;
+  std::chrono::steady_clock::time_point load_updated;
+  std::array<estimate, video_profiles.size()> estimates;
+  uint64_t spins = 0;
+  uint64_t bytes_uploaded = 0;
+};